@@ -11,65 +11,247 @@
  *
  *============================================================================*/
 
-#include <stdlib.h>		// rand, srand, malloc
-#include <string.h>		// strcpy
+#include <stdlib.h>		// malloc, strtoll
+#include <stdio.h>		// FILE, fopen, rename
+#include <string.h>		// strcpy, strcmp
 #include <fstream>		// printf, time
 #include <iostream>		// cin
 #include <limits>		// cin control
+#include <string>		// string
+#include <vector>		// vector
+#include <algorithm>	// sort, next_permutation, upper_bound
+#include <atomic>		// atomic
+#include <map>			// map
+#include <queue>		// priority_queue
+#include <random>		// mt19937_64
+#include <thread>		// thread, hardware_concurrency
+#include <mutex>		// mutex, unique_lock
+#include <condition_variable>	// condition_variable
+#include <unistd.h>		// ftruncate, fsync
+#include <signal.h>		// signal, SIGINT
 #include <sys/time.h>	// gettimeofday
 #include "colorlogs.h"	// LOG_COLOR() functions
  
-/* Macros */
-#define subwidth_POW2 sub_width*sub_width
-#define subwidth_POW4 sub_width*sub_width*sub_width*sub_width
+/* Unit types (unit id = type*grid_width + position) */
+#define ROW_UNIT   0
+#define COL_UNIT   1
+#define BLOCK_UNIT 2
+
+#define MAX_GRID_WIDTH    16
+
+/* Batch mode */
+#define FORMAT_FILES      1		// Two ascii files per puzzle
+#define FORMAT_LINES      2		// One "index puzzle solution" line per puzzle
+#define BATCH_WINDOW      1024	// Max finished puzzles waiting for their turn
+#define CHECKPOINT_EVERY  1024	// Puzzles between checkpoints...
+#define CHECKPOINT_SECS   5		// ...or seconds, whichever comes first
+
+/* Catalog */
+#define CATALOG_MAX_CELLS 16	// Grids small enough to enumerate outright
 
 /* Global variables */
-short  sub_width;			// Block width aka region width
-short  difficulty_level;	// (1 Easy, 2 Normal)
-short  output_total;		// Total number of puzzles to generate
-short* main_puzzle;			// 1D Array : size = [sub_width ^4]
-short* solved_puzzle;		// 1D Array : size = [sub_width ^4]
-bool** available_space;		// 2D Array : size = [sub_width ^2] [sub_width ^4]
+short  sub_width;			// Block width aka region width (columns)
+short  sub_height;			// Block height (rows)
+short  grid_width;			// Cells per row, column and block
+short  grid_cells;			// Cells per puzzle = grid_width ^2
+short  peer_count;			// Cells sharing a unit with any given cell
+short  difficulty_level;	// (1 Easy, 2 Normal, 3 Minimal)
+long long output_total;		// Total number of puzzles to generate
+short  worker_threads;		// Threads used for parallel removal checks
+bool   most_constrained = false;	// Pick among the cells with fewest candidates
+unsigned long long base_seed;	// Puzzle i is generated from base_seed and i
+bool   use_catalog = true;	// Serve grids small enough from the catalog
+short  catalog_clues;		// Clue count drawn from the catalog, 0 for default
+
+/* Batch options */
+short  batch_threads;		// Threads generating puzzles side by side
+short  output_format = FORMAT_LINES;
+long long shard_index = 0;	// This process covers shard i of N
+long long shard_total = 1;
+const char* output_path;	// Lines output (default "puzzles-<i>.txt")
+const char* checkpoint_path;	// Resume file, none if NULL
+short** unit_cells;			// 2D Array : size = [3*grid_width] [grid_width]
+short** cell_units;			// 2D Array : size = [grid_cells] [3]
+short** cell_peers;			// 2D Array : size = [grid_cells] [peer_count]
+
+/* Solver state (one copy per thread) */
+thread_local short* main_puzzle;		// 1D Array : size = [grid_cells]
+thread_local short* solved_puzzle;		// 1D Array : size = [grid_cells]
+thread_local bool** available_space;	// 2D Array : size = [grid_width] [grid_cells]
+thread_local std::mt19937_64 rng;		// Reseeded for every puzzle
+
+/* Unsolved cells bucketed by remaining candidates (one copy per thread) */
+thread_local short** open_buckets;		// 2D Array : size = [grid_width+1] [grid_cells]
+thread_local short*  bucket_size;		// 1D Array : size = [grid_width+1]
+thread_local short*  bucket_slot;		// 1D Array : size = [grid_cells]  (-1 once solved)
+thread_local short*  candidate_count;	// 1D Array : size = [grid_cells]
+thread_local short   open_total;		// Unsolved cells
+
+/* Restart bookkeeping */
+struct restart_stats {
+	long runs;			// Attempts started
+	long successes;		// Attempts that reached a full solution
+	long steps;			// Steps spent over all attempts
+};
+thread_local restart_stats attempt_stats;	// This thread
+thread_local long  puzzle_restarts;			// Restarts spent on the last puzzle
+thread_local long  puzzle_steps;			// Generator steps spent on the last puzzle
+restart_stats total_stats;					// All threads, see merge_restart_stats()
+std::mutex    stats_lock;
+
+/* Generation budget, see generate_puzzle() */
+enum generation_status {
+	GEN_OK,					// Puzzle is in main_puzzle / solved_puzzle
+	GEN_EXCEEDED_BUDGET,	// Ran out of time or work, puzzle is unusable
+	GEN_CANCELLED			// Cancel flag was raised, puzzle is unusable
+};
+
+struct generation_budget {
+	double    seconds;					// Wall clock limit, 0 for none
+	long long work;						// Work unit limit, 0 for none
+	const std::atomic<bool>* cancel;	// Raised by the caller to stop, or NULL
+};
+
+struct generation_result {
+	generation_status status;
+	long long work;			// Generator steps and propagation passes
+	long      attempts;		// create_puzzle() attempts, including the last
+	long      steps;		// Generator steps over all attempts
+	double    seconds;
+};
+
+thread_local const generation_budget* active_budget;	// NULL when unbounded
+thread_local generation_status budget_status;
+thread_local long long budget_work;
+thread_local timeval   budget_start;
+
+generation_budget batch_budget;			// From --budget-ms / --budget-work
+long long batch_budget_ms;				// --budget-ms as given, 0 for none
+std::atomic<bool> cancel_requested(false);	// Raised by SIGINT / SIGTERM
+
+/* Batch run shared by the generator threads */
+struct batch_job {
+	std::mutex lock;
+	std::condition_variable turn;		// next_write moved
+	long long end;						// One past the shard's last puzzle
+	long long next_claim;				// Next puzzle to hand out
+	long long next_write;				// Next puzzle to write, all before are out
+	long long written;					// Since the last checkpoint
+	long long over_budget;				// Puzzles that ran out of budget...
+	long long from_cache;				// ...and were replaced by a cached one
+	timeval   checkpointed;
+	std::map<long long, std::string> done;	// Finished, waiting for their turn
+	FILE* out;
+};
+
+/* Every grid and unique puzzle of a small geometry, see build_catalog() */
+struct catalog_table {
+	std::vector<unsigned long long> bits;	// [mask] [catalog_words] : grids
+	long long count[CATALOG_MAX_CELLS+1];	// Puzzles per clue count
+	std::vector<long long> masks[CATALOG_MAX_CELLS+1];		// Masks holding puzzles...
+	std::vector<long long> cumulative[CATALOG_MAX_CELLS+1];	// ...and running totals
+};
+std::vector<unsigned long long> catalog_grids;	// Sorted, 4 bits per cell
+std::vector<std::vector<short> > catalog_roots;	// Subtrees of the grid search
+std::vector<std::vector<unsigned long long> > catalog_found;	// Grids per subtree
+catalog_table catalog_unique;		// Clue sets that pin down their grid
+catalog_table catalog_minimal;		// ...and lose it without any one clue
+short catalog_words;				// Bitset words per mask
+bool  catalog_ready;
 
 /* prototypes */
+int   batch_main(int argc, char** argv);
+short parse_choice(const char* value, const char* const* names);
+bool  parse_number(const char* value, long long* number);
+bool  parse_args(int argc, char** argv);
+void  print_usage();
+int   merge_outputs(int argc, char** argv);
+bool  read_checkpoint(batch_job* job, long long* offset);
+void  write_checkpoint(batch_job* job);
+void  batch_worker(batch_job* job);
+void  request_cancel(int);
 void  prompt();
-bool  invalid_sub_width();
+bool  invalid_grid_width();
 bool  invalid_difficulty();
 bool  invalid_number();
+void  build_unit_tables();
 void  allocate_puzzle_memory();
+void  seed_puzzle(long long index);
+short random_below(short n);
+long long random_index(long long n);
+generation_result generate_puzzle(const generation_budget* budget);
+void  start_budget(const generation_budget* budget);
+bool  out_of_budget();
+double seconds_since(const timeval* start);
 void  init_memory();
+void  reset_open_cells();
+void  add_open_cell(short index, short candidates);
+void  remove_open_cell(short index);
+void  claim_space(short val, short index);
+short pick_open_cell();
 void  create_puzzle();
-void  insert_value(short x, short y, short val);
-short get_index(short x, short y);
+void  record_attempt(long steps, bool solved);
+void  merge_restart_stats();
+void  print_restart_summary();
+void  insert_value(short index, short val);
 bool  has_unique_solution();
 bool  update_solution();
 void  advanced_availability_check();
+void  solve_from_clues();
 void  prune_puzzle();
-void  print_puzzle(short index);
+short count_solutions(short* grid, short limit);
+short count_completions(short* cells, int* used, short limit);
+bool  clue_removable(short* clues, short cell);
+void  minimize_puzzle();
+void  minimize_in_parallel(short* clues, std::vector<short>* order);
+void  parallel_worker(void (*task)(long long), std::atomic<long long>* next, long long count);
+void  run_parallel(void (*task)(long long), long long count);
+bool  catalog_fits(short* grid, short cell, short val);
+void  collect_roots(short* grid, short cell);
+void  complete_grid(short* grid, short cell, std::vector<unsigned long long>* found);
+void  catalog_complete_root(long long root);
+void  catalog_find_unique(long long mask);
+void  catalog_find_minimal(long long mask);
+void  index_catalog(catalog_table* table);
+void  build_catalog();
+catalog_table* catalog_target(short* clues);
+long long catalog_total(catalog_table* table, short clues);
+void  sample_catalog();
+char  cell_symbol(short value);
+void  format_line(long long index, std::string* line);
+void  build_line(char* line, char fill);
+void  print_puzzle(long long index);
+void  free_puzzle_memory();
 void  free_memory();
 
 
 /*=============================================================================
  *	main()
  *===========================================================================*/
-int main() 
+int main(int argc, char** argv) 
 {
 	double runtime;
 	timeval start, substart, end;
-	srand (time(NULL));
+	worker_threads = std::thread::hardware_concurrency();
+	if (worker_threads < 1) worker_threads = 1;
+	
+	// Command line options mean a batch run
+	if (argc > 1) return batch_main(argc, argv);
 	
 	// Set up phase
 	prompt();								// Take user input 
+	base_seed = time(NULL);
+	build_unit_tables();					// Geometry lookup tables
+	if (use_catalog && grid_cells <= CATALOG_MAX_CELLS) build_catalog();
+	allocate_puzzle_memory();
 	gettimeofday(&start, NULL);				// full runtime timer
-	short total_files = output_total;
+	long long total_files = output_total;
 	do {
 		gettimeofday(&substart, NULL);		// single puzzle timer
-		allocate_puzzle_memory();
-		init_memory();
 		
 		// Creation phase
-		create_puzzle();
-		if (difficulty_level > 1) prune_puzzle();
+		seed_puzzle(output_total - total_files);
+		generate_puzzle(NULL);
 		
 		// Output phase
 		print_puzzle(output_total - total_files + 1);
@@ -77,20 +259,564 @@ int main()
 
 		runtime = end.tv_sec + end.tv_usec / 1000000.0;
 		runtime -= substart.tv_sec + substart.tv_usec / 1000000.0;
-		printf(" (in %.4f sec)\n", runtime);
+		printf(" (in %.4f sec, %ld restarts)\n", runtime, puzzle_restarts);
 	} while (--total_files > 0);
 	
 	printf("\n");
 	runtime = end.tv_sec + end.tv_usec / 1000000.0;
 	runtime -= start.tv_sec + start.tv_usec / 1000000.0;
-	LOG_GREEN(" Created %d puzzles ", output_total); 
-	printf(" (%.4f sec)\n\n", runtime);
+	LOG_GREEN(" Created %lld puzzles ", output_total); 
+	printf(" (%.4f sec)\n", runtime);
+	merge_restart_stats();
+	print_restart_summary();
+	printf("\n");
 	
 	// Exit phase
+	free_puzzle_memory();
+	free_memory();
+	return 0;
+}
+
+/*=============================================================================
+ *	batch main
+ *
+ *	description: Non-interactive run.  Puzzle i of a job is generated from
+ *				 the seed and i alone, so shards and thread counts don't
+ *				 change the output, except that a puzzle over budget is
+ *				 replaced by that thread's last cached one.
+ *===========================================================================*/
+int batch_main(int argc, char** argv)
+{
+	double runtime;
+	timeval start, end;
+	
+	if (strcmp(argv[1], "--merge") == 0)
+		return merge_outputs(argc - 2, argv + 2);
+	
+	if (strcmp(argv[1], "--help") == 0) {
+		print_usage();
+		return 0;
+	}
+	
+	if (!parse_args(argc, argv)) {
+		print_usage();
+		return 1;
+	}
+	build_unit_tables();
+	
+	if (use_catalog && grid_cells <= CATALOG_MAX_CELLS) {
+		build_catalog();
+		
+		short clues;
+		catalog_table* table = catalog_target(&clues);
+		if (catalog_total(table, clues) == 0) {
+			LOG_CRIM("The catalog has no puzzles with %d clues\n", clues);
+			free_memory();
+			return 1;
+		}
+	} else if (catalog_clues != 0) {
+		LOG_CRIM("--clues needs a catalog grid (at most %d cells)\n", CATALOG_MAX_CELLS);
+		free_memory();
+		return 1;
+	}
+	
+	// This shard's slice of the job
+	batch_job job;
+	long long per_shard = output_total / shard_total;
+	long long extra = output_total % shard_total;
+	long long first = per_shard*shard_index + (shard_index < extra ? shard_index : extra);
+	job.end = first + per_shard + (shard_index < extra ? 1 : 0);
+	job.next_claim = first;
+	job.next_write = first;
+	job.written = 0;
+	job.over_budget = 0;
+	job.from_cache = 0;
+	job.out = NULL;
+	
+	// Pick up where the checkpoint left off
+	long long offset = 0;
+	if (checkpoint_path && !read_checkpoint(&job, &offset)) {
+		free_memory();
+		return 1;
+	}
+	
+	if (output_format == FORMAT_LINES) {
+		job.out = fopen(output_path, offset > 0 ? "r+" : "w");
+		if (job.out == NULL) {
+			LOG_CRIM("Can't open %s\n", output_path);
+			free_memory();
+			return 1;
+		}
+		
+		// Drop lines written after the checkpoint, but never pad a short file
+		fseek(job.out, 0, SEEK_END);
+		if (offset > 0 && (ftell(job.out) < offset || ftruncate(fileno(job.out), offset) != 0)) {
+			LOG_CRIM("%s is shorter than checkpoint %s expects\n", output_path, checkpoint_path);
+			fclose(job.out);
+			free_memory();
+			return 1;
+		}
+		fseek(job.out, 0, SEEK_END);
+	}
+	
+	LOG_GREEN(" [Generating Sodoku]");
+	printf(" puzzles %lld to %lld of %lld (shard %lld/%lld, seed %llu)\n",
+		job.next_write + 1, job.end, output_total, shard_index, shard_total, base_seed);
+	
+	gettimeofday(&start, NULL);
+	job.checkpointed = start;
+	long long resumed_at = job.next_write;
+	
+	// Stop cleanly on Ctrl-C so the checkpoint covers everything written
+	batch_budget.cancel = &cancel_requested;
+	signal(SIGINT, request_cancel);
+	signal(SIGTERM, request_cancel);
+	
+	std::vector<std::thread> workers;
+	for (short t = 0; t < batch_threads; t++)
+		workers.push_back(std::thread(batch_worker, &job));
+	for (size_t t = 0; t < workers.size(); t++)
+		workers[t].join();
+	
+	if (checkpoint_path) write_checkpoint(&job);
+	if (job.out) fclose(job.out);
+	gettimeofday(&end, NULL);
+	
+	printf("\n");
+	runtime = end.tv_sec + end.tv_usec / 1000000.0;
+	runtime -= start.tv_sec + start.tv_usec / 1000000.0;
+	LOG_GREEN(" Created %lld puzzles ", job.next_write - resumed_at - (job.over_budget - job.from_cache)); 
+	printf(" (%.4f sec)\n", runtime);
+	if (job.over_budget > 0) {
+		LOG_YELLOW(" %lld over budget ", job.over_budget);
+		printf(" (%lld replaced from cache, %lld skipped)\n", job.from_cache, job.over_budget - job.from_cache);
+	}
+	if (cancel_requested) {
+		LOG_YELLOW(" Cancelled ");
+		printf(" at puzzle %lld%s\n", job.next_write + 1, checkpoint_path ? ", run again to resume" : "");
+	}
+	print_restart_summary();
+	printf("\n");
+	
 	free_memory();
 	return 0;
 }
 
+/*=============================================================================
+ *	parse choice
+ *
+ *	description: Accepts either a name from the list or its 1 based number.
+ *===========================================================================*/
+short parse_choice(const char* value, const char* const* names)
+{
+	for (short i = 0; names[i] != NULL; i++) {
+		if (strcmp(value, names[i]) == 0) return i+1;
+	}
+	return atoi(value);
+}
+
+/*=============================================================================
+ *	parse number
+ *===========================================================================*/
+bool parse_number(const char* value, long long* number)
+{
+	char* end;
+	*number = strtoll(value, &end, 10);
+	return *value != '\0' && *end == '\0';
+}
+
+/*=============================================================================
+ *	parse command line arguments
+ *===========================================================================*/
+bool parse_args(int argc, char** argv)
+{
+	const char* const difficulty_names[] = { "easy", "normal", "minimal", NULL };
+	const char* const format_names[] = { "files", "lines", NULL };
+	const char* const value_options[] = { "--size", "--difficulty", "--format", "--count",
+		"--seed", "--threads", "--shard", "--output", "--checkpoint", "--clues",
+		"--budget-ms", "--budget-work", NULL };
+	static char default_output[64];
+	long long number;
+	bool seeded = false;
+	
+	// Defaults
+	grid_width = 9;
+	difficulty_level = 1;
+	output_total = 1;
+	base_seed = time(NULL);
+	batch_threads = worker_threads;
+	
+	for (int i = 1; i < argc; i++) {
+		const char* arg = argv[i];
+		
+		if (strcmp(arg, "--most-constrained") == 0) {
+			most_constrained = true;
+			continue;
+		}
+		if (strcmp(arg, "--no-catalog") == 0) {
+			use_catalog = false;
+			continue;
+		}
+		short option = 0;
+		while (value_options[option] != NULL && strcmp(arg, value_options[option]) != 0)
+			option++;
+		if (value_options[option] == NULL) {
+			LOG_CRIM("Unknown option %s\n", arg);
+			return false;
+		}
+		if (i + 1 == argc) {
+			LOG_CRIM("Missing value for %s\n", arg);
+			return false;
+		}
+		const char* value = argv[++i];
+		
+		if (strcmp(arg, "--size") == 0) {
+			grid_width = atoi(value);
+		} else if (strcmp(arg, "--difficulty") == 0) {
+			difficulty_level = parse_choice(value, difficulty_names);
+		} else if (strcmp(arg, "--format") == 0) {
+			output_format = parse_choice(value, format_names);
+		} else if (strcmp(arg, "--count") == 0) {
+			if (!parse_number(value, &output_total)) output_total = 0;
+		} else if (strcmp(arg, "--seed") == 0) {
+			char* end;
+			base_seed = strtoull(value, &end, 10);
+			if (*end != '\0') {
+				LOG_CRIM("Invalid seed\n");
+				return false;
+			}
+			seeded = true;
+		} else if (strcmp(arg, "--threads") == 0) {
+			if (!parse_number(value, &number) || number < 1 || number > 1024) {
+				LOG_CRIM("Invalid thread count\n");
+				return false;
+			}
+			batch_threads = number;
+		} else if (strcmp(arg, "--shard") == 0) {
+			char extra;
+			if (sscanf(value, "%lld/%lld%c", &shard_index, &shard_total, &extra) != 2
+				|| shard_total < 1 || shard_index < 0 || shard_index >= shard_total) {
+				LOG_CRIM("Invalid shard, expected i/N with 0 <= i < N\n");
+				return false;
+			}
+		} else if (strcmp(arg, "--output") == 0) {
+			output_path = value;
+		} else if (strcmp(arg, "--checkpoint") == 0) {
+			checkpoint_path = value;
+		} else if (strcmp(arg, "--clues") == 0) {
+			if (!parse_number(value, &number) || number < 1 || number > CATALOG_MAX_CELLS) {
+				LOG_CRIM("Invalid clue count\n");
+				return false;
+			}
+			catalog_clues = number;
+		} else if (strcmp(arg, "--budget-ms") == 0) {
+			if (!parse_number(value, &number) || number < 1) {
+				LOG_CRIM("Invalid time budget\n");
+				return false;
+			}
+			batch_budget_ms = number;
+			batch_budget.seconds = number / 1000.0;
+		} else if (strcmp(arg, "--budget-work") == 0) {
+			if (!parse_number(value, &batch_budget.work) || batch_budget.work < 1) {
+				LOG_CRIM("Invalid work budget\n");
+				return false;
+			}
+		}
+	}
+	
+	if (invalid_grid_width() || invalid_difficulty() || invalid_number())
+		return false;
+	
+	if (output_format != FORMAT_FILES && output_format != FORMAT_LINES) {
+		LOG_CRIM("Invalid format\n");
+		return false;
+	}
+	
+	// A time seed can't be repeated, so resumed and sharded jobs name theirs
+	if (!seeded && (checkpoint_path != NULL || shard_total > 1)) {
+		LOG_CRIM("--checkpoint and --shard need an explicit --seed\n");
+		return false;
+	}
+	
+	if (output_path == NULL) {
+		sprintf(default_output, "puzzles-%lld.txt", shard_index);
+		output_path = default_output;
+	}
+	
+	// Puzzles already run side by side, so check removals one at a time
+	if (batch_threads > 1) worker_threads = 1;
+	
+	return true;
+}
+
+/*=============================================================================
+ *	print usage
+ *===========================================================================*/
+void print_usage()
+{
+	printf("\n");
+	printf("usage: sodoku_gen [options]\n");
+	printf("       sodoku_gen --merge OUTPUT SHARD_OUTPUT...\n");
+	printf("       sodoku_gen (no options for the interactive prompt)\n");
+	printf("\n");
+	printf("  --size N           grid width: 4, 6, 8, 9, 12, 15 or 16 (9)\n");
+	printf("  --difficulty D     easy, normal or minimal (easy)\n");
+	printf("  --count N          puzzles in the whole job (1)\n");
+	printf("  --seed S           job seed (current time)\n");
+	printf("  --threads T        generator threads (one per core)\n");
+	printf("  --format F         lines or files (lines)\n");
+	printf("  --shard i/N        generate shard i of N, 0 based (0/1)\n");
+	printf("  --output PATH      lines output (puzzles-<i>.txt)\n");
+	printf("  --checkpoint PATH  save progress to PATH and resume from it\n");
+	printf("  --most-constrained pick among the open cells with fewest candidates\n");
+	printf("  --clues C          draw catalog puzzles with C clues\n");
+	printf("  --no-catalog       generate 4x4 grids instead of using the catalog\n");
+	printf("  --budget-ms N      give up on a puzzle after N milliseconds\n");
+	printf("  --budget-work N    give up on a puzzle after N steps and passes\n");
+	printf("\n");
+	printf("Lines are \"number puzzle solution\", with '.' for empty cells.  Shards of\n");
+	printf("the same job are merged in puzzle order with --merge.  --shard and\n");
+	printf("--checkpoint need an explicit --seed, so reruns match.  4x4 puzzles\n");
+	printf("are drawn uniformly from a catalog of every grid and unique puzzle.  A\n");
+	printf("puzzle over budget is replaced by the thread's last good one, or skipped.\n");
+	printf("\n");
+}
+
+/*=============================================================================
+ *	merge outputs
+ *
+ *	description: Combines shard outputs (each already in puzzle order) into
+ *				 one file ordered by puzzle number.  paths[0] is the output.
+ *===========================================================================*/
+int merge_outputs(int count, char** paths)
+{
+	typedef std::pair<long long, int> head;		// Puzzle number, input
+	
+	if (count < 2) {
+		print_usage();
+		return 1;
+	}
+	
+	int inputs = count - 1;
+	std::vector<std::ifstream*> files(inputs);
+	std::vector<std::string> lines(inputs);
+	std::priority_queue<head, std::vector<head>, std::greater<head> > heads;
+	bool failed = false;
+	
+	for (int i = 0; i < inputs; i++) {
+		files[i] = new std::ifstream(paths[i+1]);
+		if (!files[i]->is_open()) {
+			LOG_CRIM("Can't open %s\n", paths[i+1]);
+			failed = true;
+		} else if (std::getline(*files[i], lines[i])) {
+			heads.push(head(strtoll(lines[i].c_str(), NULL, 10), i));
+		}
+	}
+	
+	FILE* out = failed ? NULL : fopen(paths[0], "w");
+	if (!failed && out == NULL) {
+		LOG_CRIM("Can't open %s\n", paths[0]);
+		failed = true;
+	}
+	
+	long long last = 0;
+	long long merged = 0;
+	while (!failed && !heads.empty()) {
+		head next = heads.top();
+		heads.pop();
+		
+		int i = next.second;
+		if (next.first <= last) {
+			LOG_CRIM("Puzzle %lld in %s is repeated or out of order\n", next.first, paths[i+1]);
+			failed = true;
+			break;
+		}
+		fputs(lines[i].c_str(), out);
+		fputc('\n', out);
+		last = next.first;
+		merged++;
+		
+		if (std::getline(*files[i], lines[i]))
+			heads.push(head(strtoll(lines[i].c_str(), NULL, 10), i));
+	}
+	
+	if (out) fclose(out);
+	for (int i = 0; i < inputs; i++)
+		delete files[i];
+	if (failed) return 1;
+	
+	LOG_GREEN(" Merged %lld puzzles ", merged);
+	printf(" into %s\n", paths[0]);
+	return 0;
+}
+
+/*=============================================================================
+ *	read checkpoint
+ *
+ *	description: Moves the job past the puzzles a previous run already wrote
+ *				 and returns the output size they ended at.  A missing file
+ *				 means a fresh start.
+ *===========================================================================*/
+bool read_checkpoint(batch_job* job, long long* offset)
+{
+	FILE* file = fopen(checkpoint_path, "r");
+	if (file == NULL) return true;
+	
+	int size, difficulty, constrained, format, catalog, clues;
+	unsigned long long seed;
+	long long count, index, total, budget_ms, budget_work, next;
+	int fields = fscanf(file, "sodoku-checkpoint size %d difficulty %d cells %d format %d "
+		"catalog %d clues %d seed %llu count %lld shard %lld/%lld budget-ms %lld budget-work %lld "
+		"next %lld offset %lld",
+		&size, &difficulty, &constrained, &format, &catalog, &clues,
+		&seed, &count, &index, &total, &budget_ms, &budget_work, &next, offset);
+	fclose(file);
+	
+	if (fields != 14) {
+		LOG_CRIM("Can't read checkpoint %s\n", checkpoint_path);
+		return false;
+	}
+	
+	if (size != grid_width || difficulty != difficulty_level || constrained != most_constrained
+		|| format != output_format || seed != base_seed
+		|| catalog != catalog_ready || clues != catalog_clues
+		|| count != output_total || index != shard_index || total != shard_total
+		|| budget_ms != batch_budget_ms || budget_work != batch_budget.work
+		|| next < job->next_write || next > job->end) {
+		LOG_CRIM("Checkpoint %s belongs to a different job\n", checkpoint_path);
+		return false;
+	}
+	
+	job->next_claim = next;
+	job->next_write = next;
+	return true;
+}
+
+/*=============================================================================
+ *	write checkpoint
+ *
+ *	description: Flushes the output, then replaces the checkpoint file in one
+ *				 rename so an interruption leaves either the old or the new.
+ *===========================================================================*/
+void write_checkpoint(batch_job* job)
+{
+	long long offset = 0;
+	if (job->out) {
+		fflush(job->out);
+		fsync(fileno(job->out));
+		offset = ftell(job->out);
+	}
+	
+	std::string temp = std::string(checkpoint_path) + ".tmp";
+	FILE* file = fopen(temp.c_str(), "w");
+	if (file == NULL) {
+		LOG_CRIM("Can't write checkpoint %s\n", temp.c_str());
+		return;
+	}
+	
+	fprintf(file, "sodoku-checkpoint size %d difficulty %d cells %d format %d "
+		"catalog %d clues %d seed %llu count %lld shard %lld/%lld budget-ms %lld budget-work %lld "
+		"next %lld offset %lld\n",
+		grid_width, difficulty_level, most_constrained, output_format,
+		catalog_ready, catalog_clues, base_seed, output_total, shard_index, shard_total,
+		batch_budget_ms, batch_budget.work, job->next_write, offset);
+	fflush(file);
+	fsync(fileno(file));
+	fclose(file);
+	rename(temp.c_str(), checkpoint_path);
+	
+	job->written = 0;
+	gettimeofday(&job->checkpointed, NULL);
+}
+
+/*=============================================================================
+ *	batch worker
+ *
+ *	description: Generates puzzles until the shard runs out or the run is
+ *				 cancelled.  Finished puzzles are written strictly in order,
+ *				 so the output and the checkpoint only ever cover a
+ *				 contiguous prefix.
+ *===========================================================================*/
+void batch_worker(batch_job* job)
+{
+	allocate_puzzle_memory();
+	std::vector<short> cached_puzzle;		// Last puzzle within budget
+	std::vector<short> cached_solution;
+	std::string line;
+	timeval now;
+	
+	std::unique_lock<std::mutex> guard(job->lock);
+	while (job->next_claim < job->end && !cancel_requested) {
+		long long index = job->next_claim++;
+		
+		// Don't run too far ahead of a slow puzzle
+		while (index >= job->next_write + BATCH_WINDOW && !cancel_requested)
+			job->turn.wait(guard);
+		if (cancel_requested) break;
+		guard.unlock();
+		
+		seed_puzzle(index);
+		generation_result result = generate_puzzle(&batch_budget);
+		
+		guard.lock();
+		if (result.status == GEN_CANCELLED) break;
+		
+		// Fall back on the last good puzzle, or leave a gap
+		bool usable = true;
+		if (result.status == GEN_EXCEEDED_BUDGET) {
+			job->over_budget++;
+			usable = !cached_puzzle.empty();
+			if (usable) {
+				job->from_cache++;
+				std::copy(cached_puzzle.begin(), cached_puzzle.end(), main_puzzle);
+				std::copy(cached_solution.begin(), cached_solution.end(), solved_puzzle);
+			}
+		} else {
+			cached_puzzle.assign(main_puzzle, main_puzzle + grid_cells);
+			cached_solution.assign(solved_puzzle, solved_puzzle + grid_cells);
+		}
+		
+		line.clear();
+		if (usable && output_format == FORMAT_LINES) format_line(index, &line);
+		if (usable && output_format == FORMAT_FILES) {
+			print_puzzle(index + 1);
+			printf("\n");
+		}
+		job->done[index] = line;
+		
+		// Write out everything that is now in order
+		while (!job->done.empty() && job->done.begin()->first == job->next_write) {
+			if (job->out) fputs(job->done.begin()->second.c_str(), job->out);
+			job->done.erase(job->done.begin());
+			job->next_write++;
+			job->written++;
+		}
+		
+		gettimeofday(&now, NULL);
+		if (checkpoint_path && job->written > 0 && (job->written >= CHECKPOINT_EVERY
+			|| now.tv_sec - job->checkpointed.tv_sec >= CHECKPOINT_SECS))
+			write_checkpoint(job);
+		
+		job->turn.notify_all();
+	}
+	job->turn.notify_all();
+	guard.unlock();
+	
+	merge_restart_stats();
+	free_puzzle_memory();
+}
+
+/*=============================================================================
+ *	request cancel
+ *
+ *	description: Signal handler.  Generation notices at its next budget
+ *				 check and the workers wind down.
+ *===========================================================================*/
+void request_cancel(int)
+{
+	cancel_requested = true;
+}
+
 /*=============================================================================
  *	prompt user input
  *===========================================================================*/
@@ -104,24 +830,25 @@ void prompt()
 	
 	printf("\n");
 	printf("This program creates sodoku puzzles.  Please\n");
-	printf("select a block size.\n");
+	printf("select a grid size.\n");
 	printf("\n");
 	
 	do {
-		LOG_WHITE("Block size? (2,3,4) \n"); 
+		LOG_WHITE("Grid size? (4,6,8,9,12,15,16) \n"); 
 		LOG_CRIM (" > "); 
 		
-		if (!(std::cin >> sub_width)) { 
+		if (!(std::cin >> grid_width)) { 
 			std::cin.clear(); 
 			std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
 		}
 		
 		printf("\n");
-	} while (invalid_sub_width());
+	} while (invalid_grid_width());
 	
 	do {
 		LOG_WHITE("Select difficulty (1: Easy) \n"); 
 		LOG_WHITE("                  (2: Normal) \n"); 
+		LOG_WHITE("                  (3: Minimal) \n"); 
 		LOG_CRIM (" > "); 
 		
 		if (!(std::cin >> difficulty_level)) { 
@@ -149,19 +876,26 @@ void prompt()
 
 /*=============================================================================
  *	input validation check
+ *
+ *	description: Maps a grid width onto its block geometry (rows x cols).
  *===========================================================================*/
-bool invalid_sub_width()
+bool invalid_grid_width()
 {
-	switch (sub_width)
+	switch (grid_width)
 	{
-		case 2:
-		case 3:
-		case 4:
-			return false;
+		case 4:  sub_height = 2; sub_width = 2; break;
+		case 6:  sub_height = 2; sub_width = 3; break;
+		case 8:  sub_height = 2; sub_width = 4; break;
+		case 9:  sub_height = 3; sub_width = 3; break;
+		case 12: sub_height = 3; sub_width = 4; break;
+		case 15: sub_height = 3; sub_width = 5; break;
+		case 16: sub_height = 4; sub_width = 4; break;
 		default:
 			LOG_CRIM ("Invalid\n"); 
 			return true;
 	}
+	grid_cells = grid_width*grid_width;
+	return false;
 }
 
 /*=============================================================================
@@ -173,6 +907,7 @@ bool invalid_difficulty()
 	{
 		case 1:
 		case 2:
+		case 3:
 			return false;
 		default:
 			LOG_CRIM ("Invalid\n"); 
@@ -191,136 +926,435 @@ bool invalid_number()
 }
 
 /*=============================================================================
- *	allocate puzzle memory
+ *	build unit tables
+ *
+ *	description: Precomputes the rows, columns and blocks of the current
+ *				 geometry so the solver never recomputes coordinates.
  *===========================================================================*/
-void allocate_puzzle_memory()
+void build_unit_tables()
 {
-	available_space = new bool* [subwidth_POW2];
-	main_puzzle = new short[subwidth_POW4];
-	solved_puzzle = new short[subwidth_POW4];
+	unit_cells = new short* [3*grid_width];
+	cell_units = new short* [grid_cells];
+	cell_peers = new short* [grid_cells];
 	
-	for (short i = 0; i < subwidth_POW2; i++) {
-		available_space[i] = new bool[subwidth_POW4];
+	for (short u = 0; u < 3*grid_width; u++)
+		unit_cells[u] = new short[grid_width];
+	
+	// Assign every cell to its row, column and block
+	short filled[3*grid_width];
+	for (short u = 0; u < 3*grid_width; u++)
+		filled[u] = 0;
+	
+	for (short i = 0; i < grid_cells; i++) {
+		short row = i / grid_width;
+		short col = i % grid_width;
+		short block = (row / sub_height) * sub_height + col / sub_width;
+		
+		cell_units[i] = new short[3];
+		cell_units[i][ROW_UNIT]   = ROW_UNIT*grid_width + row;
+		cell_units[i][COL_UNIT]   = COL_UNIT*grid_width + col;
+		cell_units[i][BLOCK_UNIT] = BLOCK_UNIT*grid_width + block;
+		
+		for (short t = 0; t < 3; t++) {
+			short u = cell_units[i][t];
+			unit_cells[u][filled[u]++] = i;
+		}
+	}
+	
+	// Peers: row + column + rest of block, each cell counted once
+	peer_count = 3*grid_width - sub_width - sub_height - 1;
+	bool is_peer[grid_cells];
+	
+	for (short i = 0; i < grid_cells; i++) {
+		for (short j = 0; j < grid_cells; j++)
+			is_peer[j] = 0;
+		
+		cell_peers[i] = new short[peer_count];
+		short count = 0;
+		for (short t = 0; t < 3; t++) {
+			short* cells = unit_cells[cell_units[i][t]];
+			for (short j = 0; j < grid_width; j++) {
+				if (cells[j] != i && !is_peer[cells[j]]) {
+					is_peer[cells[j]] = 1;
+					cell_peers[i][count++] = cells[j];
+				}
+			}
+		}
 	}
 }
 
 /*=============================================================================
- *	initialize memory
+ *	allocate puzzle memory
  *===========================================================================*/
-void init_memory()
+void allocate_puzzle_memory()
 {
-	for (short i = 0; i < subwidth_POW2; i++)
-		for (short k = 0; k < subwidth_POW4; k++)
-			available_space[i][k] = 0;
+	available_space = new bool* [grid_width];
+	main_puzzle = new short[grid_cells];
+	solved_puzzle = new short[grid_cells];
 	
-	for (short i = 0; i < subwidth_POW4; i++)	{
-		main_puzzle[i] = 0;
-		solved_puzzle[i] = 0;
+	for (short i = 0; i < grid_width; i++) {
+		available_space[i] = new bool[grid_cells];
+	}
+	
+	open_buckets = new short* [grid_width+1];
+	bucket_size = new short[grid_width+1];
+	bucket_slot = new short[grid_cells];
+	candidate_count = new short[grid_cells];
+	
+	for (short b = 0; b <= grid_width; b++) {
+		open_buckets[b] = new short[grid_cells];
 	}
 }
 
 /*=============================================================================
- *	create puzzle
+ *	seed puzzle
+ *
+ *	description: Seeds this thread's generator for puzzle index of the job.
+ *				 The splitmix64 finalizer gives neighbouring puzzles
+ *				 unrelated streams.
  *===========================================================================*/
-void create_puzzle()
+void seed_puzzle(long long index)
 {
-	short rand_col;
-	short rand_row;
-	short rand_val;
-	
-	// some tests show this is a good max out number
-	short maxout = subwidth_POW4*sub_width;
-	
-	// possible unbounded runtime? ruh roh
+	unsigned long long z = base_seed + (index + 1) * 0x9E3779B97F4A7C15ULL;
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	rng.seed(z ^ (z >> 31));
+}
+
+/*=============================================================================
+ *	random below
+ *===========================================================================*/
+short random_below(short n)
+{
+	return rng() % n;
+}
+
+/*=============================================================================
+ *	random index
+ *
+ *	description: Exactly uniform in [0, n).  Draws straight from rng(), so
+ *				 every standard library picks the same index for a seed.
+ *===========================================================================*/
+long long random_index(long long n)
+{
+	unsigned long long range = n;
+	unsigned long long limit = ~0ULL - ~0ULL % range;	// Whole multiples of range
+	unsigned long long draw;
 	do {
-		// Randomization
-		rand_row = rand() % (subwidth_POW2) + 1;
-		rand_col = rand() % (subwidth_POW2) + 1;
-		
-		// Value possibilities
-		short pool[subwidth_POW2];
-		short cardinality = 0;
-		short index = get_index(rand_col, rand_row);
-		for (short i = 0; i < subwidth_POW2; i++) {
-			if (available_space[i][index] == 0) {
-				pool[cardinality] = i+1;
-				cardinality++;
-			}
-		}
-		
-		// Value insertion
-		if (cardinality > 0) {
-			rand_val = pool[rand() % cardinality];
-			main_puzzle[get_index(rand_col, rand_row)] = rand_val;
-			insert_value(rand_col, rand_row, rand_val);
-		}
-		
-		// Solution updating
-		bool updating;
-		do {
-			updating = update_solution();
-		} while (updating);
-		
-		// Backtrack control
-		maxout--;
-		if (maxout == 0) {
-			init_memory();	// Reset
-			maxout = subwidth_POW4*sub_width;
-		}
-	} while (!has_unique_solution());
+		draw = rng();
+	} while (draw >= limit);
+	return draw % range;
 }
 
 /*=============================================================================
- *	insert value
+ *	generate puzzle
  *===========================================================================*/
-void insert_value(short x, short y, short val)
+generation_result generate_puzzle(const generation_budget* budget)
 {
-	solved_puzzle[get_index(x,y)] = val;
-	
-	val--; // Now using val as index
+	generation_result result;
+	start_budget(budget);
+	puzzle_restarts = 0;
+	puzzle_steps = 0;
 	
-	for (short i = 1; i <= subwidth_POW2; i++) {
-		available_space[val][get_index(x,i)] = 1;	// Claim row
-		available_space[val][get_index(i,y)] = 1;	// Claim col
+	init_memory();
+	if (catalog_ready) {
+		sample_catalog();
+	} else {
+		create_puzzle();
+		if (budget_status == GEN_OK && difficulty_level == 2) prune_puzzle();
+		if (budget_status == GEN_OK && difficulty_level == 3) minimize_puzzle();
 	}
 	
-	for (short k = 0; k < subwidth_POW2; k++)
-		available_space[k][get_index(x,y)] = 1;		// Claim spot
-	
-	// Truncate
-	x--; y--;
-	x /= sub_width;
-	y /= sub_width;
-	x *= sub_width;
-	y *= sub_width;
-	
-	for (short i = 1; i <= sub_width; i++)
-		for (short j = 1; j <= sub_width; j++)
-			available_space[val][get_index(i+x,j+y)] = 1;	// Claim sub square
-	
-	advanced_availability_check();
-	
-	/* Check for puzzle validation here? */
+	result.status = budget_status;
+	result.work = budget_work;
+	result.attempts = puzzle_restarts + 1;
+	result.steps = puzzle_steps;
+	result.seconds = seconds_since(&budget_start);
+	active_budget = NULL;
+	return result;
 }
 
 /*=============================================================================
- *	get index
+ *	start budget
+ *
+ *	description: Makes budget (NULL for none) the limit for this thread's
+ *				 next generation.
  *===========================================================================*/
-short get_index(short x, short y)
+void start_budget(const generation_budget* budget)
 {
-	x--; y--;
-	return y*subwidth_POW2 + x;
+	active_budget = budget;
+	budget_status = GEN_OK;
+	budget_work = 0;
+	gettimeofday(&budget_start, NULL);
 }
 
 /*=============================================================================
- *	unique solution test
+ *	out of budget
+ *
+ *	description: Counts one unit of work and tells whether generation has to
+ *				 stop.  Once it says so it keeps saying so.  The clock is
+ *				 read on every call, since a 16x16 pass or removal round
+ *				 costs far more than the read.
  *===========================================================================*/
-bool has_unique_solution()
+bool out_of_budget()
 {
-	for (short i = 0; i < subwidth_POW4; i++)	{
-		if (solved_puzzle[i] == 0) return false;
+	if (budget_status != GEN_OK) return true;
+	if (active_budget == NULL) return false;
+	
+	budget_work++;
+	if (active_budget->cancel && active_budget->cancel->load(std::memory_order_relaxed)) {
+		budget_status = GEN_CANCELLED;
+	} else if (active_budget->work > 0 && budget_work > active_budget->work) {
+		budget_status = GEN_EXCEEDED_BUDGET;
+	} else if (active_budget->seconds > 0 && seconds_since(&budget_start) > active_budget->seconds) {
+		budget_status = GEN_EXCEEDED_BUDGET;
 	}
-	return true;
+	return budget_status != GEN_OK;
+}
+
+/*=============================================================================
+ *	seconds since
+ *===========================================================================*/
+double seconds_since(const timeval* start)
+{
+	timeval now;
+	gettimeofday(&now, NULL);
+	
+	double runtime = now.tv_sec + now.tv_usec / 1000000.0;
+	runtime -= start->tv_sec + start->tv_usec / 1000000.0;
+	return runtime;
+}
+
+/*=============================================================================
+ *	initialize memory
+ *===========================================================================*/
+void init_memory()
+{
+	for (short i = 0; i < grid_width; i++)
+		for (short k = 0; k < grid_cells; k++)
+			available_space[i][k] = 0;
+	
+	for (short i = 0; i < grid_cells; i++)	{
+		main_puzzle[i] = 0;
+		solved_puzzle[i] = 0;
+	}
+	
+	reset_open_cells();
+}
+
+/*=============================================================================
+ *	reset open cells
+ *
+ *	description: Puts every cell back in the top bucket, matching an empty
+ *				 claim space.
+ *===========================================================================*/
+void reset_open_cells()
+{
+	for (short b = 0; b <= grid_width; b++)
+		bucket_size[b] = 0;
+	
+	open_total = 0;
+	for (short i = 0; i < grid_cells; i++)
+		add_open_cell(i, grid_width);
+}
+
+/*=============================================================================
+ *	add open cell
+ *===========================================================================*/
+void add_open_cell(short index, short candidates)
+{
+	short* bucket = open_buckets[candidates];
+	bucket_slot[index] = bucket_size[candidates];
+	bucket[bucket_size[candidates]++] = index;
+	candidate_count[index] = candidates;
+	open_total++;
+}
+
+/*=============================================================================
+ *	remove open cell
+ *
+ *	description: Swaps the last cell of the bucket into the freed slot.
+ *===========================================================================*/
+void remove_open_cell(short index)
+{
+	short* bucket = open_buckets[candidate_count[index]];
+	short slot = bucket_slot[index];
+	short last = bucket[--bucket_size[candidate_count[index]]];
+	
+	bucket[slot] = last;
+	bucket_slot[last] = slot;
+	bucket_slot[index] = -1;
+	open_total--;
+}
+
+/*=============================================================================
+ *	claim space
+ *
+ *	description: Marks val (0 based) unavailable at index and moves the cell
+ *				 down a bucket if it is still open.
+ *===========================================================================*/
+void claim_space(short val, short index)
+{
+	if (available_space[val][index]) return;
+	available_space[val][index] = 1;
+	
+	if (bucket_slot[index] >= 0) {
+		short candidates = candidate_count[index];
+		remove_open_cell(index);
+		add_open_cell(index, candidates - 1);
+	}
+}
+
+/*=============================================================================
+ *	pick open cell
+ *
+ *	description: Picks a random unsolved cell, or a random one among those
+ *				 with the fewest candidates when most_constrained is set.
+ *				 Returns -1 if an unsolved cell has no candidates left.
+ *===========================================================================*/
+short pick_open_cell()
+{
+	if (bucket_size[0] > 0 || open_total == 0) return -1;
+	
+	if (most_constrained) {
+		short b = 1;
+		while (bucket_size[b] == 0) b++;
+		return open_buckets[b][random_below(bucket_size[b])];
+	}
+	
+	short pick = random_below(open_total);
+	short b = 1;
+	while (pick >= bucket_size[b]) {
+		pick -= bucket_size[b];
+		b++;
+	}
+	return open_buckets[b][pick];
+}
+
+/*=============================================================================
+ *	create puzzle
+ *===========================================================================*/
+void create_puzzle()
+{
+	short rand_val;
+	bool  solved;
+	
+	long run = 0;
+	long steps = 0;
+	
+	// unbounded unless the generation has a budget
+	do {
+		// Randomization
+		short index = pick_open_cell();
+		
+		if (index >= 0) {
+			// Value possibilities
+			short pool[grid_width];
+			short cardinality = 0;
+			for (short i = 0; i < grid_width; i++) {
+				if (available_space[i][index] == 0) {
+					pool[cardinality] = i+1;
+					cardinality++;
+				}
+			}
+			
+			// Value insertion
+			rand_val = pool[random_below(cardinality)];
+			main_puzzle[index] = rand_val;
+			insert_value(index, rand_val);
+			
+			// Solution updating
+			bool updating;
+			do {
+				updating = update_solution();
+			} while (updating);
+		}
+		
+		// Backtrack control (a cell without candidates is a dead end, and
+		// every attempt gets there or to a solution within grid_cells steps)
+		steps++;
+		puzzle_steps++;
+		solved = has_unique_solution();
+		if (!solved && out_of_budget()) break;
+		if (!solved && bucket_size[0] > 0) {
+			record_attempt(steps, false);
+			init_memory();	// Reset
+			steps = 0;
+			run++;
+		}
+	} while (!solved);
+	
+	// An attempt cut off by the budget is neither a success nor a restart
+	if (budget_status == GEN_OK) record_attempt(steps, solved);
+	puzzle_restarts = run;
+}
+
+/*=============================================================================
+ *	record attempt
+ *===========================================================================*/
+void record_attempt(long steps, bool solved)
+{
+	attempt_stats.runs++;
+	attempt_stats.steps += steps;
+	if (solved) attempt_stats.successes++;
+}
+
+/*=============================================================================
+ *	merge restart stats
+ *
+ *	description: Adds this thread's restart stats to the run totals.
+ *===========================================================================*/
+void merge_restart_stats()
+{
+	std::lock_guard<std::mutex> guard(stats_lock);
+	
+	total_stats.runs += attempt_stats.runs;
+	total_stats.successes += attempt_stats.successes;
+	total_stats.steps += attempt_stats.steps;
+}
+
+/*=============================================================================
+ *	print restart summary
+ *===========================================================================*/
+void print_restart_summary()
+{
+	if (total_stats.runs == 0) return;		// All from the catalog
+	
+	LOG_CYAN(" Attempts ");
+	printf(" (%ld attempts, %ld restarts, %.1f steps per puzzle)\n",
+		total_stats.runs, total_stats.runs - total_stats.successes,
+		total_stats.successes ? (double) total_stats.steps / total_stats.successes : 0.0);
+}
+
+/*=============================================================================
+ *	insert value
+ *===========================================================================*/
+void insert_value(short index, short val)
+{
+	solved_puzzle[index] = val;
+	if (bucket_slot[index] >= 0)
+		remove_open_cell(index);
+	
+	val--; // Now using val as index
+	
+	for (short k = 0; k < grid_width; k++)
+		available_space[k][index] = 1;				// Claim spot
+	
+	short* peers = cell_peers[index];
+	for (short i = 0; i < peer_count; i++)
+		claim_space(val, peers[i]);					// Claim row, col & block
+	
+	advanced_availability_check();
+	
+	/* Check for puzzle validation here? */
+}
+
+/*=============================================================================
+ *	unique solution test
+ *===========================================================================*/
+bool has_unique_solution()
+{
+	return open_total == 0;
 }
 
 /*=============================================================================
@@ -332,7 +1366,7 @@ void prune_puzzle()
 	short removed_value = 0;
 	
 	// for each non zero in main_puzzle
-	for (short i = 0; i < subwidth_POW4; i++) {
+	for (short i = 0; i < grid_cells && budget_status == GEN_OK; i++) {
 		if (main_puzzle[i] != 0) {
 			// save element info
 			removed_index = i;
@@ -341,34 +1375,13 @@ void prune_puzzle()
 			// remove the element
 			main_puzzle[i] = 0;
 			
-			// reset claim space & known puzzle
-			for (short j = 0; j < subwidth_POW2; j++)
-				for (short k = 0; k < subwidth_POW4; k++)
-					available_space[j][k] = 0;
-			
-			for (short j = 0; j < subwidth_POW4; j++)	{
-				solved_puzzle[j] = 0;
-			}
-			
-			// calculate claim space
-			for (short j = 0; j < subwidth_POW4; j++) {
-				if (main_puzzle[j] != 0) {
-					int x = 1+j % (subwidth_POW2);
-					int y = 1+j / (subwidth_POW2);
-					insert_value(x, y, main_puzzle[j]);
-				}
-			}
-			
 			// calculate known
-			bool updating;
-			do {
-				updating = update_solution();
-			} while (updating);
+			solve_from_clues();
 			
 			// check for zero elements in known
 			// if zero element exists, place the element back
 			short k = 0;
-			while (k < subwidth_POW4) {
+			while (k < grid_cells) {
 				if (solved_puzzle[k] == 0) {
 					main_puzzle[removed_index] = removed_value;
 					solved_puzzle[removed_index] = removed_value;
@@ -380,83 +1393,381 @@ void prune_puzzle()
 	}
 	
 	// calculate solution
-	for (short j = 0; j < subwidth_POW4; j++) {
+	solve_from_clues();
+}
+
+/*=============================================================================
+ *	solve from clues
+ *
+ *	description: Resets the claim space and known puzzle, then solves as far
+ *				 as possible from the clues in main_puzzle.
+ *===========================================================================*/
+void solve_from_clues()
+{
+	// reset claim space & known puzzle
+	for (short j = 0; j < grid_width; j++)
+		for (short k = 0; k < grid_cells; k++)
+			available_space[j][k] = 0;
+	
+	for (short j = 0; j < grid_cells; j++)	{
+		solved_puzzle[j] = 0;
+	}
+	reset_open_cells();
+	
+	// calculate claim space
+	for (short j = 0; j < grid_cells; j++) {
 		if (main_puzzle[j] != 0) {
-			int x = 1+j % (subwidth_POW2);
-			int y = 1+j / (subwidth_POW2);
-			insert_value(x, y, main_puzzle[j]);
+			insert_value(j, main_puzzle[j]);
 		}
 	}
+	
+	// calculate known
 	bool updating;
 	do {
 		updating = update_solution();
 	} while (updating);
+}
+
+/*=============================================================================
+ *	count solutions
+ *
+ *	description: Counts the ways to complete grid (0 for an empty cell) by
+ *				 backtracking, stopping once limit is reached.  Keeps its
+ *				 own unit masks, so the solver state is left alone.
+ *===========================================================================*/
+short count_solutions(short* grid, short limit)
+{
+	short cells[grid_cells];
+	int   used[3*grid_width];
+	
+	for (short u = 0; u < 3*grid_width; u++)
+		used[u] = 0;
+	
+	for (short i = 0; i < grid_cells; i++) {
+		cells[i] = grid[i];
+		if (grid[i] == 0) continue;
+		
+		int bit = 1 << (grid[i] - 1);
+		for (short u = 0; u < 3; u++) {
+			if (used[cell_units[i][u]] & bit) return 0;	// Clashing clues
+			used[cell_units[i][u]] |= bit;
+		}
+	}
+	return count_completions(cells, used, limit);
+}
+
+/*=============================================================================
+ *	count completions
+ *
+ *	description: Fills forced cells first (a value with one place left in a
+ *				 unit), otherwise branches on the empty cell with the fewest
+ *				 candidates.  An attempt over budget counts as limit, so
+ *				 callers treat it as not unique.
+ *===========================================================================*/
+short count_completions(short* cells, int* used, short limit)
+{
+	if (out_of_budget()) return limit;
+	
+	int   all = (1 << grid_width) - 1;
+	int   options[grid_cells];
+	short best = -1;
+	short best_count = grid_width + 1;
+	int   best_options = 0;
+	
+	for (short i = 0; i < grid_cells; i++) {
+		if (cells[i] != 0) continue;
+		
+		short* units = cell_units[i];
+		options[i] = all & ~(used[units[0]] | used[units[1]] | used[units[2]]);
+		short count = __builtin_popcount(options[i]);
+		if (count == 0) return 0;
+		if (count < best_count) {
+			best = i;
+			best_count = count;
+			best_options = options[i];
+		}
+	}
+	if (best < 0) return 1;		// Every cell filled
+	
+	// Values with a single place left in some unit
+	for (short u = 0; u < 3*grid_width && best_count > 1; u++) {
+		int once = 0, twice = 0;
+		for (short k = 0; k < grid_width; k++) {
+			short i = unit_cells[u][k];
+			if (cells[i] != 0) continue;
+			twice |= once & options[i];
+			once |= options[i];
+		}
+		int open = all & ~used[u];
+		if (open & ~once) return 0;		// A value with nowhere to go
+		
+		int single = open & ~twice;
+		if (single == 0) continue;
+		best_options = single & -single;
+		for (short k = 0; k < grid_width; k++) {
+			short i = unit_cells[u][k];
+			if (cells[i] == 0 && (options[i] & best_options)) best = i;
+		}
+		best_count = 1;
+	}
 	
+	short found = 0;
+	short* units = cell_units[best];
+	while (best_options != 0 && found < limit) {
+		int bit = best_options & -best_options;
+		best_options ^= bit;
+		
+		cells[best] = __builtin_ctz(bit) + 1;
+		for (short u = 0; u < 3; u++) used[units[u]] |= bit;
+		found += count_completions(cells, used, limit - found);
+		for (short u = 0; u < 3; u++) used[units[u]] &= ~bit;
+	}
+	cells[best] = 0;
+	return found;
+}
+
+/*=============================================================================
+ *	clue removable
+ *
+ *	description: Tells whether clues still has exactly one solution without
+ *				 the clue at cell.  The propagation solver settles most
+ *				 cases; the rest are counted by backtracking.
+ *===========================================================================*/
+bool clue_removable(short* clues, short cell)
+{
+	for (short j = 0; j < grid_cells; j++)
+		main_puzzle[j] = clues[j];
+	main_puzzle[cell] = 0;
+	
+	solve_from_clues();
+	if (has_unique_solution()) return true;
+	if (budget_status != GEN_OK) return false;
+	return count_solutions(solved_puzzle, 2) == 1;	// Deductions so far hold
+}
+
+/*=============================================================================
+ *	removal round
+ *
+ *	description: Work shared between minimize_puzzle() and its workers.  Each
+ *				 round, worker t checks whether candidates[t] can be removed
+ *				 from clues without losing the unique solution.  Workers run
+ *				 under the caller's budget and hand back the work they did.
+ *===========================================================================*/
+struct removal_round {
+	std::mutex lock;
+	std::condition_variable wake;		// New round or quit
+	std::condition_variable done;		// All workers finished the round
+	short* clues;
+	short* candidates;
+	bool*  removable;
+	short  count;						// Candidates this round
+	short  running;						// Workers still busy this round
+	int    round;
+	bool   quit;
+	const generation_budget* budget;	// Caller's budget, NULL for none
+	timeval   start;					// Caller's budget start
+	long long work_base;				// Caller's work at the round start
+	long long work_spent;				// Worker work this round
+	generation_status status;			// First worker stop this round
+};
+
+/*=============================================================================
+ *	removal worker
+ *===========================================================================*/
+void removal_worker(removal_round* work, short id)
+{
+	allocate_puzzle_memory();		// Private copy of the solver state
+	int seen = 0;
+	
+	std::unique_lock<std::mutex> guard(work->lock);
+	while (true) {
+		while (!work->quit && work->round == seen)
+			work->wake.wait(guard);
+		if (work->quit) break;
+		seen = work->round;
+		
+		if (id < work->count) {
+			active_budget = work->budget;
+			budget_start = work->start;
+			budget_status = GEN_OK;
+			budget_work = work->work_base;
+			guard.unlock();
+			
+			bool removable = clue_removable(work->clues, work->candidates[id]);
+			
+			guard.lock();
+			work->removable[id] = removable;
+			work->work_spent += budget_work - work->work_base;
+			if (budget_status != GEN_OK && work->status == GEN_OK)
+				work->status = budget_status;
+		}
+		
+		if (--work->running == 0)
+			work->done.notify_one();
+	}
+	guard.unlock();
+	
+	free_puzzle_memory();
+}
+
+/*=============================================================================
+ *	minimize puzzle
+ *
+ *	description: Removes clues in a random order until no clue can be removed
+ *				 without losing the unique solution.  Removal checks run in
+ *				 parallel, one candidate per worker, and the result is the
+ *				 same as checking the shuffled clues one at a time.
+ *===========================================================================*/
+void minimize_puzzle()
+{
+	short clues[grid_cells];
+	short solution[grid_cells];
+	std::vector<short> pending;
+	
+	for (short i = 0; i < grid_cells; i++) {
+		clues[i] = main_puzzle[i];
+		solution[i] = solved_puzzle[i];
+		if (main_puzzle[i] != 0) pending.push_back(i);
+	}
+	
+	// Random removal order
+	for (short i = pending.size() - 1; i > 0; i--) {
+		short j = random_below(i + 1);
+		short swap = pending[i];
+		pending[i] = pending[j];
+		pending[j] = swap;
+	}
+	
+	if (worker_threads == 1) {
+		// No one to share with, so check in place
+		for (size_t k = 0; k < pending.size() && !out_of_budget(); k++) {
+			if (clue_removable(clues, pending[k])) clues[pending[k]] = 0;
+		}
+	} else {
+		minimize_in_parallel(clues, &pending);
+	}
+	
+	// The solver may not get all the way from the clues, but the solution
+	// they pin down is still the one they were taken from
+	for (short i = 0; i < grid_cells; i++)
+		main_puzzle[i] = clues[i];
+	solve_from_clues();
+	for (short i = 0; i < grid_cells; i++)
+		solved_puzzle[i] = solution[i];
+}
+
+/*=============================================================================
+ *	minimize in parallel
+ *
+ *	description: Runs the removal checks of minimize_puzzle() in rounds of
+ *				 worker_threads candidates.
+ *===========================================================================*/
+void minimize_in_parallel(short* clues, std::vector<short>* order)
+{
+	std::vector<short>& pending = *order;
+	removal_round work;
+	short candidates[worker_threads];
+	bool  removable[worker_threads];
+	work.clues = clues;
+	work.candidates = candidates;
+	work.removable = removable;
+	work.round = 0;
+	work.quit = false;
+	work.budget = active_budget;
+	work.start = budget_start;
+	
+	std::vector<std::thread> workers;
+	for (short t = 0; t < worker_threads; t++)
+		workers.push_back(std::thread(removal_worker, &work, t));
+	
+	size_t next = 0;
+	while (next < pending.size() && !out_of_budget()) {
+		// Check the next window of candidates against the current clues
+		std::unique_lock<std::mutex> guard(work.lock);
+		work.count = 0;
+		while (work.count < worker_threads && next + work.count < pending.size()) {
+			candidates[work.count] = pending[next + work.count];
+			work.count++;
+		}
+		work.work_base = budget_work;
+		work.work_spent = 0;
+		work.status = GEN_OK;
+		work.running = worker_threads;
+		work.round++;
+		work.wake.notify_all();
+		while (work.running > 0)
+			work.done.wait(guard);
+		
+		budget_work += work.work_spent;
+		if (work.status != GEN_OK) {
+			budget_status = work.status;
+			break;
+		}
+		
+		// Remove the first removable clue.  Clues that can't be removed now
+		// stay, since fewer clues never solve more.  Later removable ones are
+		// checked again against the smaller set.
+		short first = 0;
+		while (first < work.count && !removable[first])
+			first++;
+		
+		if (first == work.count) {
+			next += work.count;
+			continue;
+		}
+		clues[candidates[first]] = 0;
+		
+		short retest = 0;
+		for (short k = first + 1; k < work.count; k++) {
+			if (removable[k]) retest++;
+		}
+		next += work.count - retest;
+		for (short k = first + 1, r = 0; k < work.count; k++) {
+			if (removable[k]) pending[next + r++] = candidates[k];
+		}
+	}
+	
+	work.lock.lock();
+	work.quit = true;
+	work.wake.notify_all();
+	work.lock.unlock();
+	for (size_t t = 0; t < workers.size(); t++)
+		workers[t].join();
 }
 
 /*=============================================================================
  *	update solution
+ *
+ *	description: Places a value wherever it has exactly one opening left in
+ *				 a row, column or block.
  *===========================================================================*/
 bool update_solution()
 {
 	bool updating = false;	// True if more updates needed
+	if (out_of_budget()) return false;
 	
 	// Value loop
-	for (short k = 0; k < subwidth_POW2; k++)	{
-		// Diagonal crawl
-		for (short j = 1; j <= subwidth_POW2; j++)	{
-			// Scan rows and columns
-			short xopenings = subwidth_POW2;
-			short yopenings = subwidth_POW2;
-			short xindex = 0;
-			short yindex = 0;
+	for (short k = 0; k < grid_width; k++)	{
+		bool* open = available_space[k];
+		
+		// Scan rows, columns and blocks
+		for (short u = 0; u < 3*grid_width; u++) {
+			short* cells = unit_cells[u];
+			short openings = 0;
+			short open_index = 0;
 			
-			for (short i = 1; i <= subwidth_POW2; i++) {
-				if (available_space[k][get_index(i,j)] == 1) {
-					xopenings--;	// Count row openings
-				} else {
-					xindex = i;		// Save index for later
-				}
-				if (available_space[k][get_index(j,i)] == 1) {
-					yopenings--;	// Count column openings
-				} else {
-					yindex = i;		// Save index for later
+			for (short i = 0; i < grid_width; i++) {
+				if (open[cells[i]] == 0) {
+					openings++;				// Count unit openings
+					open_index = cells[i];	// Save index for later
 				}
 			}
 			
-			if (xopenings == 1) {
-				insert_value(xindex, j, k+1);
-				updating = true;
-			} else if (yopenings == 1) {
-				insert_value(j, yindex, k+1);
+			if (openings == 1) {
+				insert_value(open_index, k+1);
 				updating = true;
 			}
 		}
-		
-		// Scan blocks
-		for (short i = 0; i < subwidth_POW2; i += sub_width) {
-			for (short j = 0; j < subwidth_POW2; j += sub_width) {	
-				short subopenings = subwidth_POW2;
-				short xindex;
-				short yindex;
-				
-				for (short y = 1; y <= sub_width; y++) {
-					for (short x = 1; x <= sub_width; x++) {
-						if (available_space[k][get_index(x+i, y+j)] == 1) {
-							subopenings--;		// Count block openings
-						} else {
-							xindex = x+i;		// Save indices
-							yindex = y+j;
-						}
-					}
-				}
-				
-				if (subopenings == 1) { 
-					insert_value(xindex, yindex, k+1);
-					updating = true;
-				}
-			}
-		}
 	}
 	
 	return updating;
@@ -471,132 +1782,453 @@ bool update_solution()
 void advanced_availability_check()
 {
 	// Iterate values
-	for (short k = 0; k < subwidth_POW2; k++)	{
+	for (short k = 0; k < grid_width; k++)	{
+		bool* open = available_space[k];
+		
 		// Iterate blocks
-		for (short j = 0; j < subwidth_POW2; j += sub_width) {
-			for (short i = 0; i < subwidth_POW2; i += sub_width) {	
-				short subopenings = subwidth_POW2;
-				short open_columns = sub_width;
-				short col_index = 0;
-				
-				// Iterate cells
-				for (short x = 1; x <= sub_width; x++) {
-					int empty_column_cells = sub_width;
-					for (short y = 1; y <= sub_width; y++) {
-						if (available_space[k][get_index(x+i, y+j)] != 0) {
-							subopenings--;				// Count block openings
-							empty_column_cells--;		// Count open columns
-						} 
-					}
-					if (empty_column_cells == 0) {
-						open_columns--;
-					} else {
-						col_index = x+i;
-					}
-				}
+		for (short b = 0; b < grid_width; b++) {
+			short block = BLOCK_UNIT*grid_width + b;
+			short* cells = unit_cells[block];
+			short subopenings = 0;
+			short row_unit = -1;
+			short col_unit = -1;
+			bool one_row = true;
+			bool one_col = true;
+			
+			// Iterate cells
+			for (short i = 0; i < grid_width; i++) {
+				if (open[cells[i]] != 0) continue;
 				
-				// Update availability
-				if (open_columns == 1 && subopenings > 1) { 
-					for (short y = 1; y <= subwidth_POW2; y++) {
-						if (y > j+sub_width || y <= j) {
-							available_space[k][get_index(col_index, y)] = 1;
-						}
-					}
+				short* units = cell_units[cells[i]];
+				subopenings++;							// Count block openings
+				if (subopenings == 1) {
+					row_unit = units[ROW_UNIT];
+					col_unit = units[COL_UNIT];
 				}
-				
-				subopenings = subwidth_POW2;
-				short open_rows = sub_width;
-				short row_index = 0;
-				
-				// Iterate cells
-				for (short y = 1; y <= sub_width; y++) {
-					int empty_row_cells = sub_width;
-					for (short x = 1; x <= sub_width; x++) {
-						if (available_space[k][get_index(x+i, y+j)] != 0) {
-							subopenings--;			// Count block openings
-							empty_row_cells--;		// Count open columns
-						} 
-					}
-					if (empty_row_cells == 0) {
-						open_rows--;
-					} else {
-						row_index = y+j;
-					}
+				if (units[ROW_UNIT] != row_unit) one_row = false;
+				if (units[COL_UNIT] != col_unit) one_col = false;
+			}
+			
+			if (subopenings <= 1) continue;
+			
+			// Update availability
+			if (one_col) {
+				short* line = unit_cells[col_unit];
+				for (short i = 0; i < grid_width; i++) {
+					if (cell_units[line[i]][BLOCK_UNIT] != block)
+						claim_space(k, line[i]);
 				}
-				
-				// Update availability
-				if (open_rows == 1 && subopenings > 1) { 
-					for (short x = 1; x <= subwidth_POW2; x++) {
-						if (x > i+sub_width || x <= i) {
-							available_space[k][get_index(x, row_index)] = 1;
-						}
-					}
+			}
+			if (one_row) {
+				short* line = unit_cells[row_unit];
+				for (short i = 0; i < grid_width; i++) {
+					if (cell_units[line[i]][BLOCK_UNIT] != block)
+						claim_space(k, line[i]);
 				}
 			}
 		}
 	}
 }
 
+/*=============================================================================
+ *	run parallel
+ *
+ *	description: Calls task(0) ... task(count-1) spread over every core.
+ *				 Tasks may only write to results of their own.
+ *===========================================================================*/
+void parallel_worker(void (*task)(long long), std::atomic<long long>* next, long long count)
+{
+	long long i;
+	while ((i = (*next)++) < count)
+		task(i);
+}
+
+void run_parallel(void (*task)(long long), long long count)
+{
+	std::atomic<long long> next(0);
+	short threads = std::thread::hardware_concurrency();
+	if (threads < 1) threads = 1;
+	
+	std::vector<std::thread> workers;
+	for (short t = 0; t < threads; t++)
+		workers.push_back(std::thread(parallel_worker, task, &next, count));
+	for (size_t t = 0; t < workers.size(); t++)
+		workers[t].join();
+}
+
+/*=============================================================================
+ *	catalog fits
+ *
+ *	description: True if val can go in cell given the cells before it.
+ *===========================================================================*/
+bool catalog_fits(short* grid, short cell, short val)
+{
+	short* peers = cell_peers[cell];
+	for (short p = 0; p < peer_count; p++) {
+		if (peers[p] < cell && grid[peers[p]] == val) return false;
+	}
+	return true;
+}
+
+/*=============================================================================
+ *	collect catalog roots
+ *
+ *	description: Every valid second row below the fixed first row.  Each one
+ *				 is the root of an independent subtree of the search.
+ *===========================================================================*/
+void collect_roots(short* grid, short cell)
+{
+	if (cell == 2*grid_width) {
+		catalog_roots.push_back(std::vector<short>(grid, grid + cell));
+		return;
+	}
+	for (short v = 1; v <= grid_width; v++) {
+		if (catalog_fits(grid, cell, v)) {
+			grid[cell] = v;
+			collect_roots(grid, cell + 1);
+		}
+	}
+}
+
+/*=============================================================================
+ *	complete catalog grid
+ *===========================================================================*/
+void complete_grid(short* grid, short cell, std::vector<unsigned long long>* found)
+{
+	if (cell == grid_cells) {
+		unsigned long long code = 0;
+		for (short i = 0; i < grid_cells; i++)
+			code |= (unsigned long long) grid[i] << (4*i);
+		found->push_back(code);
+		return;
+	}
+	for (short v = 1; v <= grid_width; v++) {
+		if (catalog_fits(grid, cell, v)) {
+			grid[cell] = v;
+			complete_grid(grid, cell + 1, found);
+		}
+	}
+}
+
+void catalog_complete_root(long long root)
+{
+	short grid[grid_cells];
+	for (size_t i = 0; i < catalog_roots[root].size(); i++)
+		grid[i] = catalog_roots[root][i];
+	complete_grid(grid, catalog_roots[root].size(), &catalog_found[root]);
+}
+
+/*=============================================================================
+ *	catalog unique puzzles
+ *
+ *	description: The clues in mask pin down a grid exactly when no other
+ *				 grid agrees with it on those cells.
+ *===========================================================================*/
+void catalog_find_unique(long long mask)
+{
+	typedef std::pair<unsigned long long, int> key;		// Clue values, grid
+	thread_local std::vector<key> keys;
+	
+	unsigned long long keep = 0;
+	for (short i = 0; i < grid_cells; i++) {
+		if (mask >> i & 1) keep |= 0xFULL << (4*i);
+	}
+	
+	int grids = catalog_grids.size();
+	keys.resize(grids);
+	for (int g = 0; g < grids; g++)
+		keys[g] = key(catalog_grids[g] & keep, g);
+	std::sort(keys.begin(), keys.end());
+	
+	unsigned long long* bits = &catalog_unique.bits[mask * catalog_words];
+	for (int g = 0; g < grids; g++) {
+		bool alone = (g == 0 || keys[g-1].first != keys[g].first)
+			&& (g == grids-1 || keys[g+1].first != keys[g].first);
+		if (alone) bits[keys[g].second / 64] |= 1ULL << (keys[g].second % 64);
+	}
+}
+
+/*=============================================================================
+ *	catalog minimal puzzles
+ *
+ *	description: Unique puzzles that stop being unique without any one clue.
+ *===========================================================================*/
+void catalog_find_minimal(long long mask)
+{
+	for (short w = 0; w < catalog_words; w++) {
+		unsigned long long bits = catalog_unique.bits[mask * catalog_words + w];
+		for (short i = 0; i < grid_cells && bits; i++) {
+			if (mask >> i & 1)
+				bits &= ~catalog_unique.bits[(mask ^ (1LL << i)) * catalog_words + w];
+		}
+		catalog_minimal.bits[mask * catalog_words + w] = bits;
+	}
+}
+
+/*=============================================================================
+ *	index catalog
+ *
+ *	description: Lists the masks holding puzzles for every clue count, with
+ *				 running totals for sampling.
+ *===========================================================================*/
+void index_catalog(catalog_table* table)
+{
+	for (short c = 0; c <= grid_cells; c++) {
+		table->count[c] = 0;
+		table->masks[c].clear();
+		table->cumulative[c].clear();
+	}
+	
+	for (long long mask = 0; mask < 1LL << grid_cells; mask++) {
+		long long puzzles = 0;
+		for (short w = 0; w < catalog_words; w++)
+			puzzles += __builtin_popcountll(table->bits[mask * catalog_words + w]);
+		if (puzzles == 0) continue;
+		
+		short clues = __builtin_popcountll(mask);
+		table->count[clues] += puzzles;
+		table->masks[clues].push_back(mask);
+		table->cumulative[clues].push_back(table->count[clues]);
+	}
+}
+
+/*=============================================================================
+ *	build catalog
+ *
+ *	description: Enumerates every solution grid with the first row fixed to
+ *				 1, 2, 3, ... (every grid is a relabelling of exactly one of
+ *				 those), then finds the unique and minimal puzzles of every
+ *				 grid.  Only practical while 2^grid_cells masks fit in memory.
+ *===========================================================================*/
+void build_catalog()
+{
+	timeval start, end;
+	gettimeofday(&start, NULL);
+	
+	// Canonical grids, one subtree per second row
+	short grid[grid_cells];
+	for (short i = 0; i < grid_width; i++)
+		grid[i] = i+1;
+	
+	catalog_roots.clear();
+	collect_roots(grid, grid_width);
+	catalog_found.assign(catalog_roots.size(), std::vector<unsigned long long>());
+	run_parallel(catalog_complete_root, catalog_roots.size());
+	
+	// Every relabelling of every canonical grid
+	short labels[grid_width];
+	for (short i = 0; i < grid_width; i++)
+		labels[i] = i+1;
+	
+	long long canonical = 0;
+	for (size_t r = 0; r < catalog_found.size(); r++)
+		canonical += catalog_found[r].size();
+	
+	catalog_grids.clear();
+	do {
+		for (size_t r = 0; r < catalog_found.size(); r++) {
+			for (size_t g = 0; g < catalog_found[r].size(); g++) {
+				unsigned long long code = catalog_found[r][g];
+				unsigned long long relabelled = 0;
+				for (short i = 0; i < grid_cells; i++)
+					relabelled |= (unsigned long long) labels[(code >> (4*i) & 0xF) - 1] << (4*i);
+				catalog_grids.push_back(relabelled);
+			}
+		}
+	} while (std::next_permutation(labels, labels + grid_width));
+	std::sort(catalog_grids.begin(), catalog_grids.end());
+	
+	// Puzzles of every grid, one task per clue mask
+	long long masks = 1LL << grid_cells;
+	catalog_words = (catalog_grids.size() + 63) / 64;
+	catalog_unique.bits.assign(masks * catalog_words, 0);
+	catalog_minimal.bits.assign(masks * catalog_words, 0);
+	run_parallel(catalog_find_unique, masks);
+	run_parallel(catalog_find_minimal, masks);
+	index_catalog(&catalog_unique);
+	index_catalog(&catalog_minimal);
+	catalog_ready = true;
+	
+	gettimeofday(&end, NULL);
+	double runtime = end.tv_sec + end.tv_usec / 1000000.0;
+	runtime -= start.tv_sec + start.tv_usec / 1000000.0;
+	
+	LOG_GREEN(" [Catalog]");
+	printf(" %zu grids (%lld up to relabelling) in %.4f sec\n", catalog_grids.size(), canonical, runtime);
+	for (short c = 0; c <= grid_cells; c++) {
+		if (catalog_unique.count[c] == 0) continue;
+		printf("   clues %2d : %lld unique, %lld minimal\n", c,
+			catalog_unique.count[c], catalog_minimal.count[c]);
+	}
+	printf("\n");
+}
+
+/*=============================================================================
+ *	catalog target
+ *
+ *	description: Minimal draws from the minimal puzzles (any clue count
+ *				 unless catalog_clues is set).  Easy and Normal draw from
+ *				 the unique puzzles with catalog_clues clues, by default
+ *				 half and three eighths of the cells.
+ *===========================================================================*/
+catalog_table* catalog_target(short* clues)
+{
+	*clues = catalog_clues;
+	if (difficulty_level == 3) return &catalog_minimal;
+	
+	if (*clues == 0) *clues = (difficulty_level == 1) ? grid_cells/2 : grid_cells*3/8;
+	return &catalog_unique;
+}
+
+/*=============================================================================
+ *	catalog total
+ *
+ *	description: Puzzles with the given clue count, or any if clues is 0.
+ *===========================================================================*/
+long long catalog_total(catalog_table* table, short clues)
+{
+	long long total = 0;
+	for (short c = 0; c <= grid_cells; c++) {
+		if (clues == 0 || c == clues) total += table->count[c];
+	}
+	return total;
+}
+
+/*=============================================================================
+ *	sample catalog
+ *
+ *	description: Loads a puzzle drawn uniformly from the catalog target into
+ *				 main_puzzle and solved_puzzle.
+ *===========================================================================*/
+void sample_catalog()
+{
+	short clues;
+	catalog_table* table = catalog_target(&clues);
+	
+	long long pick = random_index(catalog_total(table, clues));
+	
+	// Clue count, then mask, then grid
+	short c = 0;
+	while ((clues != 0 && c != clues) || pick >= table->count[c]) {
+		if (clues == 0 || c == clues) pick -= table->count[c];
+		c++;
+	}
+	
+	std::vector<long long>& cumulative = table->cumulative[c];
+	size_t at = std::upper_bound(cumulative.begin(), cumulative.end(), pick) - cumulative.begin();
+	long long mask = table->masks[c][at];
+	if (at > 0) pick -= cumulative[at-1];
+	
+	unsigned long long* bits = &table->bits[mask * catalog_words];
+	short w = 0;
+	while (pick >= __builtin_popcountll(bits[w])) {
+		pick -= __builtin_popcountll(bits[w]);
+		w++;
+	}
+	unsigned long long word = bits[w];
+	for (; pick > 0; pick--)
+		word &= word - 1;		// Drop the lowest grids
+	
+	unsigned long long code = catalog_grids[w*64 + __builtin_ctzll(word)];
+	for (short i = 0; i < grid_cells; i++) {
+		solved_puzzle[i] = code >> (4*i) & 0xF;
+		main_puzzle[i] = (mask >> i & 1) ? solved_puzzle[i] : 0;
+	}
+}
+
+/*=============================================================================
+ *	cell symbol
+ *
+ *	description: 1-9 up to 9x9, letters from A on bigger grids.
+ *===========================================================================*/
+char cell_symbol(short value)
+{
+	short ascii_offset = (grid_width <= 9) ? 48 : 64;
+	return value + ascii_offset;
+}
+
+/*=============================================================================
+ *	format line
+ *
+ *	description: Appends "number puzzle solution" for the lines format, with
+ *				 '.' for empty cells.
+ *===========================================================================*/
+void format_line(long long index, std::string* line)
+{
+	char number[24];
+	sprintf(number, "%lld ", index + 1);
+	line->append(number);
+	
+	for (short i = 0; i < grid_cells; i++)
+		line->push_back(main_puzzle[i] ? cell_symbol(main_puzzle[i]) : '.');
+	line->push_back(' ');
+	
+	for (short i = 0; i < grid_cells; i++)
+		line->push_back(cell_symbol(solved_puzzle[i]));
+	line->push_back('\n');
+}
+
+/*=============================================================================
+ *	build print line
+ *
+ *	description: Lays out one line of the ascii grid.  Cells are filled with
+ *				 fill, separated by ':' and by "::" between blocks.
+ *===========================================================================*/
+void build_line(char* line, char fill)
+{
+	short len = 0;
+	line[len++] = ':';
+	line[len++] = ':';
+	for (short k = 0; k < grid_width; k++) {
+		for (short c = 0; c < 5; c++)
+			line[len++] = fill;
+		line[len++] = ':';
+		if ((k+1) % sub_width == 0)
+			line[len++] = ':';
+	}
+	line[len++] = '\n';
+	line[len] = '\0';
+}
+
 /*=============================================================================
  *	print puzzle
  *===========================================================================*/
-void print_puzzle(short index)
+void print_puzzle(long long index)
 {
-	short ascii_offset = (sub_width != 4) ? 48 : 64;
-	short size = 100; 	// sloppy max size
-	char* line1 = (char*) malloc(size);
+	short size = 7*grid_width + 8;
 	char* line2 = (char*) malloc(size);
 	char* line3 = (char*) malloc(size);
 	char* line4 = (char*) malloc(size);
 	char* line5 = (char*) malloc(size);
-	char* filename = (char*) malloc(size);
+	char* filename = (char*) malloc(100);
 	
 	std::ofstream outfile;
 	switch (difficulty_level) {
-		case 1: sprintf (filename, "Easy Sodoku %i (3x3).txt", index);	 break;
-		case 2: sprintf (filename, "Normal Sodoku %i (3x3).txt", index); break;
+		case 1: sprintf (filename, "Easy Sodoku %lld (%ix%i).txt", index, sub_height, sub_width);	 break;
+		case 2: sprintf (filename, "Normal Sodoku %lld (%ix%i).txt", index, sub_height, sub_width); break;
+		case 3: sprintf (filename, "Minimal Sodoku %lld (%ix%i).txt", index, sub_height, sub_width); break;
 	}
 	outfile.open (filename);
 	
-	switch (sub_width)
-	{
-		case 4:
-			strcpy(line1, "......................................................................................................\n");
-			strcpy(line2, "::     :     :     :     ::     :     :     :     ::     :     :     :     ::     :     :     :     ::\n");
-			strcpy(line3, "::  _  :  _  :  _  :  _  ::  _  :  _  :  _  :  _  ::  _  :  _  :  _  :  _  ::  _  :  _  :  _  :  _  ::\n");
-			strcpy(line4, "::.....:.....:.....:.....::.....:.....:.....:.....::.....:.....:.....:.....::.....:.....:.....:.....::\n");
-			strcpy(line5, "::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::\n");
-			break;
-		case 3:
-			strcpy(line1, "...........................................................\n");
-			strcpy(line2, "::     :     :     ::     :     :     ::     :     :     ::\n");
-			strcpy(line3, "::  x  :  y  :  z  ::  a  :  b  :  c  ::  1  :  2  :  3  ::\n");
-			strcpy(line4, "::.....:.....:.....::.....:.....:.....::.....:.....:.....::\n");
-			strcpy(line5, ":::::::::::::::::::::::::::::::::::::::::::::::::::::::::::\n");
-			break;
-		case 2:	
-			strcpy(line1, "............................\n");
-			strcpy(line2, "::     :     ::     :     ::\n");
-			strcpy(line3, "::  x  :  y  ::  z  :  a  ::\n");
-			strcpy(line4, "::.....:.....::.....:.....::\n");
-			strcpy(line5, "::::::::::::::::::::::::::::\n");
-			break;
-	}
+	build_line(line2, ' ');
+	build_line(line3, ' ');
+	build_line(line4, '.');
+	build_line(line5, ':');
 	
 	outfile << "\nSodoku Puzzle:\n\n";
-	for (short i = 0; i < subwidth_POW2; i++)
+	for (short i = 0; i < grid_width; i++)
 	{
-		if (i % sub_width == 0)
+		if (i % sub_height == 0)
 			outfile << line5;
 		else
 			outfile << line4;
 		
-		for (short k = 0; k < subwidth_POW2; k++)
+		for (short k = 0; k < grid_width; k++)
 		{
 			int ascii_index = 6*k+4 + k/sub_width;
-			int main_index = i*subwidth_POW2 + k;
+			int main_index = i*grid_width + k;
 			if (main_puzzle[main_index] != 0) {
-				line3[ascii_index] = main_puzzle[main_index]+ascii_offset;
+				line3[ascii_index] = cell_symbol(main_puzzle[main_index]);
 			} else {
 				line3[ascii_index] = ' ';
 			}
@@ -612,25 +2244,26 @@ void print_puzzle(short index)
 	
 	outfile.close();
 	switch (difficulty_level) {
-		case 1: sprintf (filename, "Easy SOLVED %i (3x3).txt", index);	 break;
-		case 2: sprintf (filename, "Normal SOLVED %i (3x3).txt", index); break;
+		case 1: sprintf (filename, "Easy SOLVED %lld (%ix%i).txt", index, sub_height, sub_width);	 break;
+		case 2: sprintf (filename, "Normal SOLVED %lld (%ix%i).txt", index, sub_height, sub_width); break;
+		case 3: sprintf (filename, "Minimal SOLVED %lld (%ix%i).txt", index, sub_height, sub_width); break;
 	}
 	outfile.open (filename);
 	
 	outfile << "\nSolution:\n\n";
-	for (short i = 0; i < subwidth_POW2; i++)
+	for (short i = 0; i < grid_width; i++)
 	{
-		if (i % sub_width == 0)
+		if (i % sub_height == 0)
 			outfile << line5;
 		else
 			outfile << line4;
 		
-		for (short k = 0; k < subwidth_POW2; k++)
+		for (short k = 0; k < grid_width; k++)
 		{
 			int ascii_index = 6*k+4 + k/sub_width;
-			int main_index = i*subwidth_POW2 + k;
+			int main_index = i*grid_width + k;
 			if (solved_puzzle[main_index] != 0) {
-				line3[ascii_index] = solved_puzzle[main_index]+ascii_offset;
+				line3[ascii_index] = cell_symbol(solved_puzzle[main_index]);
 			} else {
 				line3[ascii_index] = ' ';
 			}
@@ -646,20 +2279,49 @@ void print_puzzle(short index)
 	
 	outfile.close();
 	free(filename);
-	free(line1); free(line2); free(line3); free(line4); free(line5);
+	free(line2); free(line3); free(line4); free(line5);
 }
 
 /*=============================================================================
- *	free memory
+ *	free puzzle memory
  *===========================================================================*/
-void free_memory()
+void free_puzzle_memory()
 {
-	for (short i = 0; i < subwidth_POW2; i++)
+	for (short i = 0; i < grid_width; i++)
 		delete [] available_space[i];
 	
 	delete [] available_space;
 	delete [] main_puzzle;
 	delete [] solved_puzzle;
+	
+	for (short b = 0; b <= grid_width; b++)
+		delete [] open_buckets[b];
+	
+	delete [] open_buckets;
+	delete [] bucket_size;
+	delete [] bucket_slot;
+	delete [] candidate_count;
+}
+
+/*=============================================================================
+ *	free memory
+ *
+ *	description: Frees the unit tables.  Solver state is freed per thread
+ *				 with free_puzzle_memory().
+ *===========================================================================*/
+void free_memory()
+{
+	for (short u = 0; u < 3*grid_width; u++)
+		delete [] unit_cells[u];
+	
+	for (short i = 0; i < grid_cells; i++) {
+		delete [] cell_units[i];
+		delete [] cell_peers[i];
+	}
+	
+	delete [] unit_cells;
+	delete [] cell_units;
+	delete [] cell_peers;
 }
 
 